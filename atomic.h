@@ -38,4 +38,129 @@ static inline int compare_and_swap(int *value, int old, int new)
 			: "memory");
 	return old;
 }
+
+/**
+ * Add @inc to *@value atomically.
+ * Return the value of *@value before the addition
+ */
+static inline int fetch_and_add(int *value, int inc)
+{
+	__asm__ volatile(
+			"lock ; xaddl %0, %1"
+			: "+r"(inc), "+m"(*value)
+			:
+			: "memory");
+	return inc;
+}
+
+/**
+ * Set *@value to @new unconditionally.
+ * Return the old value of *@value
+ */
+static inline int swap(int *value, int new)
+{
+	__asm__ volatile(
+			"xchgl %0, %1"
+			: "+r"(new), "+m"(*value)
+			:
+			: "memory");
+	return new;
+}
+
+/**
+ * Pointer-sized variants of the above. xchg has an implicit lock prefix.
+ * Return the old value of *@ptr
+ */
+static inline void *swap_pointer(void **ptr, void *new)
+{
+	__asm__ volatile(
+			"xchg %0, %1"
+			: "+r"(new), "+m"(*ptr)
+			:
+			: "memory");
+	return new;
+}
+
+static inline void *compare_and_swap_pointer(void **ptr, void *old, void *new)
+{
+	__asm__ volatile(
+			"lock ; cmpxchg %3, %1"
+			: "=a"(old), "=m"(*ptr)
+			: "a"(old), "r"(new)
+			: "memory");
+	return old;
+}
+
+/**
+ * Long variant of compare_and_swap() for counters that must not wrap around.
+ * Return the old value of *@value
+ */
+static inline unsigned long compare_and_swap_long(unsigned long *value, unsigned long old, unsigned long new)
+{
+	__asm__ volatile(
+			"lock ; cmpxchg %3, %1"
+			: "=a"(old), "=m"(*value)
+			: "a"(old), "r"(new)
+			: "memory");
+	return old;
+}
+
+/**
+ * Set and clear the bits of *@value in @mask atomically.
+ */
+static inline void atomic_or_long(unsigned long *value, unsigned long mask)
+{
+	__asm__ volatile(
+			"lock ; or %1, %0"
+			: "+m"(*value)
+			: "r"(mask)
+			: "memory");
+}
+
+static inline void atomic_and_long(unsigned long *value, unsigned long mask)
+{
+	__asm__ volatile(
+			"lock ; and %1, %0"
+			: "+m"(*value)
+			: "r"(mask)
+			: "memory");
+}
+
+/**
+ * Hint the processor that we are in a spin-wait loop. Keeps the spinning
+ * core from flooding the pipeline with speculative loads and yields the
+ * execution resources to the sibling hyperthread.
+ */
+static inline void cpu_relax(void)
+{
+	__asm__ volatile("pause" ::: "memory");
+}
+
+/**
+ * Prevent the compiler from reordering memory accesses across this point.
+ * x86 keeps stores in order, so this is enough for the release side.
+ */
+#define barrier() __asm__ volatile("" ::: "memory")
+
+/**
+ * Full memory barrier. x86 may let a load pass an earlier store to another
+ * location, and this is the only ordering that needs a real fence.
+ */
+#define smp_mb() __asm__ volatile("mfence" ::: "memory")
+
+/**
+ * Force a real load/store of @x. Use it when spinning on a plain read
+ * so that the compiler does not hoist the load out of the loop.
+ */
+#define ACCESS_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+
+/**
+ * Load *@p with acquire semantics and store @v into *@p with release
+ * semantics. x86 never reorders loads with later accesses nor stores with
+ * earlier ones, so it is enough to keep the compiler from doing so.
+ */
+#define load_acquire(p) \
+	({ __typeof__(*(p)) ___v = ACCESS_ONCE(*(p)); barrier(); ___v; })
+#define store_release(p, v) \
+	do { barrier(); ACCESS_ONCE(*(p)) = (v); } while (0)
 #endif
@@ -18,39 +18,78 @@
 #include <string.h>
 #include <pthread.h>
 #include <assert.h>
+#include <errno.h>
 
 #include "types.h"
 #include "counter.h"
 
-static pthread_t counter_thread = 0;
+static pthread_t counter_threads[MAX_CONSUMERS] = {0};
 
 static unsigned long nr_requests = 0;
-static unsigned long value_counter[MAX_VALUE] = {0};
+static unsigned long value_counter[MAX_CONSUMERS][MAX_VALUE] = {{0}};
 
 int counter_delay_usec = 0;
 
-int __dequeue_rb(void);
+int __dequeue_rb(const int consumer);
+int __dequeue_burst_rb(const int consumer, int *values, const int max);
+unsigned long __dropped_rb(void);
+int __try_dequeue_rb(const int source, int *value);
 
 void *counter_main(void *_args_)
 {
+	int id = (long)_args_;
+	int nr;
+	int source = 0;
+
 	if (verbose)
 		printf("Counting %lu requests...\n", nr_requests);
 
-	for (unsigned long i = 0; i < nr_requests; i++)
+	/**
+	 * A lossy ring buffer drops values instead of delivering them. Every
+	 * value is either counted, dropped, or yet to come, so stop waiting
+	 * once the counted and dropped ones add up to @nr_requests.
+	 */
+	for (unsigned long i = 0; ; i += nr)
 	{
-		/* Take out a value from the ring buffer */
-		int value = __dequeue_rb();
+		unsigned long nr_left = nr_requests - i - __dropped_rb();
+		int values[ring_batch];
 
-		/* Count it */
-		value_counter[value]++;
+		if (!nr_left)
+			break;
 
-		if (counter_delay_usec)
-			usleep(counter_delay_usec);
+		/* Take out values from the ring buffer */
+		if (nr_sources > 1)
+		{
+			/* Move on to the next ring buffer whenever one is empty */
+			while (__try_dequeue_rb(source, values) == -EAGAIN)
+				source = (source + 1) % nr_sources;
+			source = (source + 1) % nr_sources;
+			nr = 1;
+		}
+		else if (ring_batch == 1)
+		{
+			values[0] = __dequeue_rb(id);
+			nr = 1;
+		}
+		else
+		{
+			nr = nr_left < ring_batch ? nr_left : ring_batch;
+			nr = __dequeue_burst_rb(id, values, nr);
+		}
 
-		if (verbose && i && i % (nr_requests >> 4) == 0)
+		for (int j = 0; j < nr; j++)
 		{
-			printf("Counter counted %lu / %lu (%lu%%)\n",
-						 i, nr_requests, i * 100 / nr_requests);
+			/* Count it */
+			value_counter[id][values[j]]++;
+
+			if (counter_delay_usec)
+				usleep(counter_delay_usec);
+		}
+
+		if (verbose && i && i % (nr_requests >> 4) < nr)
+		{
+			printf("Counter %d counted %lu / %lu (%lu%%)\n",
+						 id, i, nr_requests, i * 100 / nr_requests);
 		}
 	}
 
@@ -64,15 +103,20 @@ int spawn_counter(const enum counter_types type, const unsigned long _nr_request
 {
 	nr_requests = _nr_requests_;
 
-	pthread_create(&counter_thread, NULL, counter_main, NULL);
+	/* Each counter sees every value when there are many of them */
+	for (long i = 0; i < nr_consumers; i++)
+		pthread_create(counter_threads + i, NULL, counter_main, (void *)i);
 	return 0;
 }
 
-void fini_counter(unsigned long values[])
+void fini_counter(unsigned long values[][MAX_VALUE])
 {
-	if (counter_thread)
+	for (int i = 0; i < nr_consumers; i++)
 	{
-		pthread_join(counter_thread, NULL);
-		memcpy(values, value_counter, sizeof(unsigned long) * MAX_VALUE);
+		if (counter_threads[i])
+		{
+			pthread_join(counter_threads[i], NULL);
+			memcpy(values[i], value_counter[i], sizeof(unsigned long) * MAX_VALUE);
+		}
 	}
 }
@@ -22,6 +22,6 @@ enum counter_types {
 };
 
 int spawn_counter(const enum counter_types, const unsigned long);
-void fini_counter(unsigned long []);
+void fini_counter(unsigned long [][MAX_VALUE]);
 
 #endif
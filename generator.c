@@ -67,27 +67,40 @@ struct generator {
 };
 static struct generator *generators = NULL;
 
-void __enqueue_rb(int value);
+void __enqueue_rb(int id, int value);
+void __enqueue_bulk_rb(int id, const int *values, const int n);
 
 void *generator_main(void *_args_)
 {
 	struct generator *my = (struct generator *)_args_;
+	int nr;
 
 	if (verbose) printf("Generator %d started...\n", my->id);
 
 	pthread_barrier_wait(&barrier); /* 1st barrier */
 
-	for (unsigned long i = 0; i < nr_generate; i++) {
-		/* Generate a number */
-		int value = my->generator_fn(my->id);
+	for (unsigned long i = 0; i < nr_generate; i += nr) {
+		int values[ring_batch];
 
-		/* The generator inserts the generated number into the ring buffer */
-		__enqueue_rb((int)value);
+		/* Generate up to @ring_batch numbers */
+		nr = nr_generate - i < ring_batch ? nr_generate - i : ring_batch;
+		for (int j = 0; j < nr; j++) {
+			values[j] = my->generator_fn(my->id);
+		}
+
+		/* The generator inserts the generated numbers into the ring buffer */
+		if (nr == 1) {
+			__enqueue_rb(my->id, values[0]);
+		} else {
+			__enqueue_bulk_rb(my->id, values, nr);
+		}
 
-		/* Account for the generated value */
-		my->generated[value]++;
+		/* Account for the generated values */
+		for (int j = 0; j < nr; j++) {
+			my->generated[values[j]]++;
+		}
 
-		if (verbose && i && i % (nr_generate >> 4) == 0) {
+		if (verbose && i && i % (nr_generate >> 4) < nr) {
 			printf("Generator %d generated %lu / %lu (%lu%%)\n",
 					my->id, i, nr_generate, i * 100 / nr_generate);
 		}
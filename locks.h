@@ -24,13 +24,66 @@ void init_spinlock(struct spinlock *);
 void acquire_spinlock(struct spinlock *);
 void release_spinlock(struct spinlock *);
 
+struct ticket_spinlock;
+void init_ticket_spinlock(struct ticket_spinlock *);
+void acquire_ticket_spinlock(struct ticket_spinlock *);
+void release_ticket_spinlock(struct ticket_spinlock *);
+
+struct mcs_spinlock;
+void init_mcs_spinlock(struct mcs_spinlock *);
+void acquire_mcs_spinlock(struct mcs_spinlock *);
+void release_mcs_spinlock(struct mcs_spinlock *);
+
+struct clh_spinlock;
+void init_clh_spinlock(struct clh_spinlock *);
+void fini_clh_spinlock(struct clh_spinlock *);
+void acquire_clh_spinlock(struct clh_spinlock *);
+void release_clh_spinlock(struct clh_spinlock *);
+
+struct ttas_spinlock;
+void init_ttas_spinlock(struct ttas_spinlock *, int min_backoff, int max_backoff);
+void acquire_ttas_spinlock(struct ttas_spinlock *);
+void release_ttas_spinlock(struct ttas_spinlock *);
+
+struct rwspinlock;
+void init_rwspinlock(struct rwspinlock *);
+void acquire_read(struct rwspinlock *);
+void release_read(struct rwspinlock *);
+void acquire_write(struct rwspinlock *);
+void release_write(struct rwspinlock *);
+
 
 /*************************************************
  * Mutex
  */
+enum mutex_policies {
+	mutex_fifo = 0,
+	mutex_barging,
+};
+
 struct mutex;
 void init_mutex(struct mutex *);
+void set_mutex_policy(struct mutex *, enum mutex_policies, unsigned int starvation_usec);
 void acquire_mutex(struct mutex *);
+bool try_acquire_mutex(struct mutex *);
 void release_mutex(struct mutex *);
 
+struct adaptive_mutex;
+void init_adaptive_mutex(struct adaptive_mutex *, int spin_budget);
+void acquire_adaptive_mutex(struct adaptive_mutex *);
+void release_adaptive_mutex(struct adaptive_mutex *);
+unsigned long adaptive_mutex_spin_acquired(struct adaptive_mutex *);
+
+
+/*************************************************
+ * Semaphore
+ */
+struct semaphore;
+void init_semaphore(struct semaphore *, const int S);
+void down(struct semaphore *);
+void up(struct semaphore *);
+void down_n(struct semaphore *, const int n);
+void up_n(struct semaphore *, const int n);
+bool try_down(struct semaphore *);
+
 #endif
@@ -15,10 +15,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
 #include <assert.h>
 
 #include "types.h"
@@ -26,12 +34,19 @@
 #include "locks.h"
 #include "generator.h"
 #include "counter.h"
+#include "park.h"
+#include "ringbuffer.h"
 
 /*************************************************
  * Lock tester.
  * Will be invoked if the program is run with -T
  */
 void test_lock(enum lock_types);
+void bench_lock(enum lock_types);
+void bench_park(void);
+void test_semaphore(const int S);
+extern enum mutex_policies mutex_policy;
+int parse_lock_type(const char *name);
 
 /* Common */
 int verbose = 1;
@@ -40,48 +55,363 @@ int verbose = 1;
 static enum generator_types generator_type = generator_constant;
 int nr_generators = 1;
 unsigned long nr_generate = 128;
+int ring_batch = 1;
 
 /* Counter */
 static enum counter_types counter_type = counter_normal;
 
 /* Ring buffer */
 static int nr_slots = 64;
+static enum ringbuffer_types ringbuffer_type = ringbuffer_spin;
+static bool ringbuffer_type_given = false;
+static struct ringbuffer *ringbuffer = NULL;
+
+/* Record ring. Each value travels in a record of RECORD_HEADROOM + padding */
+#define RECORD_HEADROOM sizeof(int)
+#define RECORD_MAX_PADDING 32
+#define RECORD_BYTES_PER_SLOT 64
+static bool use_records = false;
+static bool use_mirror = false;
+static unsigned int resize_flags = 0;
+static bool use_lossy = false;
+
+/* Counters taking every value from the broadcast ring */
+int nr_consumers = 1;
+
+/* Generator i puts into sources[i % nr_sources], and the counter polls them */
+int nr_sources = 1;
+static struct ringbuffer **sources = NULL;
+static struct record_ring *record_ring = NULL;
+static const char *ringbuffer_type_names[] = {
+	[ringbuffer_spin] = "spin",
+	[ringbuffer_sem] = "sem",
+	[ringbuffer_spsc] = "spsc",
+	[ringbuffer_mpmc] = "mpmc",
+	[ringbuffer_mask] = "mask",
+	[ringbuffer_shard] = "shard",
+	[ringbuffer_broadcast] = "bcast",
+};
 
 /*********************************************************************
  * Common implementation
  */
-void enqueue_into_ringbuffer(int value);
-int dequeue_from_ringbuffer(void);
-void fini_ringbuffer(void);
-int init_ringbuffer(const int nr_slots);
+/**
+ * The payload of a record is the value followed by (value % RECORD_MAX_PADDING)
+ * bytes filled with the value, which are written and checked in place.
+ */
+static void __enqueue_record(int value)
+{
+	size_t len = RECORD_HEADROOM + value % RECORD_MAX_PADDING;
+	char *payload;
+
+	payload = reserve_record(record_ring, len);
+	assert(payload);
+
+	*(int *)payload = value;
+	memset(payload + RECORD_HEADROOM, value, len - RECORD_HEADROOM);
+	commit_record(record_ring, payload);
+}
+
+static int __dequeue_record(void)
+{
+	size_t len;
+	char *payload;
+	int value;
+
+	payload = peek_record(record_ring, &len);
+	value = *(int *)payload;
+	assert(len == RECORD_HEADROOM + value % RECORD_MAX_PADDING);
+	for (int i = RECORD_HEADROOM; i < len; i++)
+		assert(payload[i] == (char)value);
+	release_record(record_ring);
 
-void __enqueue_rb(int value)
+	return value;
+}
+
+void __enqueue_rb(int id, int value)
 {
 	assert(value >= MIN_VALUE && value < MAX_VALUE);
-	enqueue_into_ringbuffer(value);
+	if (record_ring)
+		__enqueue_record(value);
+	else if (sources)
+		enqueue_into_ringbuffer(sources[id % nr_sources], value);
+	else if (use_lossy)
+		overwrite_into_ringbuffer(ringbuffer, id, value);
+	else if (ringbuffer_type == ringbuffer_shard)
+		enqueue_into_shard(ringbuffer, id, value);
+	else
+		enqueue_into_ringbuffer(ringbuffer, value);
 }
 
-int __dequeue_rb(void)
+int __dequeue_rb(const int consumer)
 {
 	int value;
 
-	value = dequeue_from_ringbuffer();
+	if (record_ring)
+		value = __dequeue_record();
+	else if (ringbuffer_type == ringbuffer_broadcast)
+		value = dequeue_for_consumer(ringbuffer, consumer);
+	else
+		value = dequeue_from_ringbuffer(ringbuffer);
 	assert(value >= MIN_VALUE && value < MAX_VALUE);
 
 	return value;
 }
 
+void __enqueue_bulk_rb(int id, const int *values, const int n)
+{
+	int nr;
+
+	for (int i = 0; i < n; i++)
+		assert(values[i] >= MIN_VALUE && values[i] < MAX_VALUE);
+
+	if (record_ring)
+	{
+		for (nr = 0; nr < n; nr++)
+			__enqueue_record(values[nr]);
+	}
+	else if (sources)
+		nr = enqueue_bulk_into_ringbuffer(sources[id % nr_sources], values, n);
+	else if (use_lossy)
+		nr = overwrite_bulk_into_ringbuffer(ringbuffer, id, values, n);
+	else if (ringbuffer_type == ringbuffer_shard)
+		nr = enqueue_bulk_into_shard(ringbuffer, id, values, n);
+	else
+		nr = enqueue_bulk_into_ringbuffer(ringbuffer, values, n);
+	assert(nr == n);
+}
+
+int __dequeue_burst_rb(const int consumer, int *values, const int max)
+{
+	int nr;
+
+	if (record_ring)
+	{
+		values[0] = __dequeue_record();
+		nr = 1;
+	}
+	else if (ringbuffer_type == ringbuffer_broadcast)
+		nr = dequeue_burst_for_consumer(ringbuffer, consumer, values, max);
+	else
+		nr = dequeue_burst_from_ringbuffer(ringbuffer, values, max);
+	assert(nr > 0 && nr <= max);
+	for (int i = 0; i < nr; i++)
+		assert(values[i] >= MIN_VALUE && values[i] < MAX_VALUE);
+
+	return nr;
+}
+
+/* Take a value from @source if there is any. Return -EAGAIN otherwise */
+int __try_dequeue_rb(const int source, int *value)
+{
+	int retval;
+
+	assert(sources && source >= 0 && source < nr_sources);
+	retval = try_dequeue_from_ringbuffer(sources[source], value);
+	if (retval == 0)
+		assert(*value >= MIN_VALUE && *value < MAX_VALUE);
+
+	return retval;
+}
+
+/* The number of values the lossy ring buffer has dropped so far */
+unsigned long __dropped_rb(void)
+{
+	return use_lossy ? get_nr_dropped(ringbuffer) : 0;
+}
+
+static struct ringbuffer *__create_rb(const int _nr_slots_, const enum ringbuffer_types type)
+{
+	if (type == ringbuffer_shard)
+		return ringbuffer_create_sharded(_nr_slots_, nr_generators);
+	if (type == ringbuffer_broadcast)
+		return ringbuffer_create_broadcast(_nr_slots_, nr_consumers);
+	return ringbuffer_create(_nr_slots_,
+			type | (use_mirror ? RINGBUFFER_MIRRORED : 0) | resize_flags);
+}
+
 static int __init_rb(const int _nr_slots_)
 {
 	assert(_nr_slots_ > 0);
-	return init_ringbuffer(_nr_slots_);
+	if (use_records)
+	{
+		size_t capacity = _nr_slots_ * RECORD_BYTES_PER_SLOT;
+		size_t min = record_ring_min_capacity(RECORD_HEADROOM + RECORD_MAX_PADDING - 1);
+
+		/* Make room for the largest record even with a few slots */
+		record_ring = record_ring_create(capacity < min ? min : capacity);
+		return record_ring ? 0 : -ENOMEM;
+	}
+	if (nr_sources > 1)
+	{
+		sources = calloc(nr_sources, sizeof(*sources));
+		if (!sources)
+			return -ENOMEM;
+		for (int i = 0; i < nr_sources; i++)
+		{
+			if (!(sources[i] = __create_rb(_nr_slots_, ringbuffer_type)))
+				return -ENOMEM;
+		}
+		ringbuffer = sources[0];
+		return 0;
+	}
+	if (use_lossy)
+	{
+		ringbuffer = ringbuffer_create_lossy(_nr_slots_, nr_generators);
+		return ringbuffer ? 0 : -ENOMEM;
+	}
+	ringbuffer = __create_rb(_nr_slots_, ringbuffer_type);
+	if (!ringbuffer && resize_flags)
+	{
+		fprintf(stderr, "Only the spin ring without -M can be resized\n");
+		return -EINVAL;
+	}
+	return ringbuffer ? 0 : -ENOMEM;
+}
+
+static void __report_shards(void)
+{
+	unsigned long nr_values, usec;
+
+	if (!ringbuffer)
+		return;
+
+	for (int i = 0; get_shard_stat(ringbuffer, i, &nr_values, &usec) == 0; i++)
+	{
+		fprintf(stderr, "           Shard %2d : %8lu values, %8lu req/sec\n",
+						i, nr_values, usec ? nr_values * 1000000 / usec : 0);
+	}
+}
+
+static void __report_drops(void)
+{
+	unsigned long nr_dropped;
+
+	if (!use_lossy)
+		return;
+
+	for (int i = 0; get_drop_stat(ringbuffer, i, &nr_dropped) == 0; i++)
+	{
+		fprintf(stderr, "       Generator %2d : %8lu values dropped\n", i, nr_dropped);
+	}
+}
+
+static unsigned long __monotonic_usec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Print the resize events with the throughput of the counter in between */
+static void __report_resizes(unsigned long start_usec, unsigned long end_usec,
+		unsigned long nr_values)
+{
+	struct ringbuffer_resize_event events[RINGBUFFER_MAX_EVENTS];
+	unsigned long prev_usec = start_usec, prev_values = 0;
+	unsigned long nr_resizes;
+	int prev_slots = nr_slots;
+	int nr;
+
+	if (!ringbuffer || !resize_flags)
+		return;
+
+	nr = get_resize_events(ringbuffer, events, RINGBUFFER_MAX_EVENTS);
+	nr_resizes = get_nr_resizes(ringbuffer);
+	fprintf(stderr, "           Resized : %lu times\n", nr_resizes);
+	for (int i = 0; i < nr; i++)
+	{
+		unsigned long usec = events[i].usec - prev_usec;
+		unsigned long values = events[i].nr_values - prev_values;
+
+		fprintf(stderr, "      %8lu.%03lu ms : %6d -> %6d slots, %lu req/sec before\n",
+						(events[i].usec - start_usec) / 1000, (events[i].usec - start_usec) % 1000,
+						prev_slots, events[i].nr_slots, usec ? values * 1000000 / usec : 0);
+		prev_usec = events[i].usec;
+		prev_values = events[i].nr_values;
+		prev_slots = events[i].nr_slots;
+	}
+	if (nr_resizes > nr)
+	{
+		/* The size after the last logged event is not the final one */
+		fprintf(stderr, "               ... : %lu more resizes not logged\n", nr_resizes - nr);
+		return;
+	}
+	if (end_usec > prev_usec)
+	{
+		fprintf(stderr, "             After : %6d slots, %lu req/sec\n", prev_slots,
+						(nr_values - prev_values) * 1000000 / (end_usec - prev_usec));
+	}
 }
 
 static void __fini_rb(void)
 {
-	fini_ringbuffer();
+	if (sources)
+	{
+		for (int i = 1; i < nr_sources; i++)
+			ringbuffer_destroy(sources[i]);
+		free(sources);
+		sources = NULL;
+	}
+	ringbuffer_destroy(ringbuffer);
+	ringbuffer = NULL;
+	record_ring_destroy(record_ring);
+	record_ring = NULL;
 }
 
+/*********************************************************************
+ * bench_ringbuffer()
+ *
+ * Measure the cost of an enqueue and a dequeue of each ring buffer type
+ * from a single thread, so that the indexing and the synchronization
+ * overhead show up without the waiting.
+ */
+#define BENCH_RINGBUFFER_OPS (1 << 22)
+
+static void bench_ringbuffer(void)
+{
+	struct ringbuffer *rb;
+	struct timespec start, end;
+	unsigned long elapsed;
+	int value;
+
+	fprintf(stderr, "  %-6s %14s\n", "ring", "ns/op");
+	for (int t = 0; t < nr_ringbuffer_types; t++)
+	{
+		if (!(rb = __create_rb(nr_slots, t)))
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < BENCH_RINGBUFFER_OPS; i++)
+		{
+			if (t == ringbuffer_shard)
+				enqueue_into_shard(rb, 0, i & (MAX_VALUE - 1));
+			else
+				enqueue_into_ringbuffer(rb, i & (MAX_VALUE - 1));
+			if (t == ringbuffer_broadcast)
+			{
+				for (int c = 0; c < nr_consumers; c++)
+				{
+					value = dequeue_for_consumer(rb, c);
+					assert(value == (i & (MAX_VALUE - 1)));
+				}
+				continue;
+			}
+			value = dequeue_from_ringbuffer(rb);
+			assert(value == (i & (MAX_VALUE - 1)));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ringbuffer_destroy(rb);
+
+		elapsed = (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec;
+		fprintf(stderr, "  %-6s %14.2f\n", ringbuffer_type_names[t],
+						(double)elapsed / (BENCH_RINGBUFFER_OPS * 2));
+	}
+}
+
+static void bench_ipc(void);
+
 static void __print_usage(const char *argv0)
 {
 	printf("Usage: %s {options}\n", argv0);
@@ -89,12 +419,40 @@ static void __print_usage(const char *argv0)
 	printf(" Run with -l or -m to check the correctness of the lock implementation\n");
 	printf("  -l         : Test spinlock implementation\n");
 	printf("  -m         : Torture blocking mutex\n");
+	printf("  -L [type]  : Test the lock of @type (spinlock, ticket, mcs, clh, ttas,\n");
+	printf("               rwspinlock, mutex, adaptive, semaphore)\n");
+	printf("  -t [number]: Torture the lock with @number threads\n");
+	printf("  -T         : Benchmark the lock with 1 to @number threads\n");
+	printf("               (sweep the read/write ratio for rwspinlock)\n");
+	printf("  -w [min:max]: Set the backoff window of the ttas lock\n");
+	printf("  -S [number]: Torture counting semaphore initialized with @number\n");
+	printf("  -F [policy]: Pass the mutex by @policy (fifo, barge[:usec])\n");
+	printf("  -a [number]: Poll @number times before parking in the adaptive mutex\n");
+	printf("  -P [type]  : Park mutex waiters with @type (signal, futex, eventfd, pipe)\n");
+	printf("  -p         : Measure the wake-up latency of the parking backends\n");
 	printf("\n");
 	printf(" Run with -r to check the ring buffer implementation\n");
 	printf("  -g [number]: Spawn @number generators for test\n");
 	printf("  -n [number]: Generate @number requests per generator\n");
 	printf("  -R         : Use random generator rather than constant generator\n");
 	printf("  -s [number]: Set the number of slots in the ring buffer\n");
+	printf("  -b [type]  : Use the ring buffer of @type (spin, sem, spsc,\n");
+	printf("               mpmc, mask, shard, bcast). spsc is used by default for a\n");
+	printf("               single generator\n");
+	printf("  -C [number]: Run @number counters that take every value from the bcast\n");
+	printf("               ring\n");
+	printf("  -B [number]: Move up to @number values per ring buffer operation\n");
+	printf("  -M         : Mirror the slots so that bulk operations never wrap around\n");
+	printf("  -I [number]: Spread the generators over @number ring buffers, and let\n");
+	printf("               the counter poll them with try-dequeue\n");
+	printf("  -O         : Overwrite the oldest values rather than waiting when the\n");
+	printf("               spin ring is full\n");
+	printf("  -G [mode]  : Let the spin ring grow when full (grow), and shrink back\n");
+	printf("               when mostly empty (shrink)\n");
+	printf("  -V         : Carry the values in variable-length records\n");
+	printf("  -X         : Compare the shared-memory ring buffer against a pipe and\n");
+	printf("               a Unix socket with the generators in child processes\n");
+	printf("  -c         : Measure the cost per operation of the ring buffer types\n");
 	printf("  -0         : Comprehensive test with realistic values\n");
 	printf("  -1         : Test full ring buffer\n");
 	printf("  -2         : Test empty ring buffer\n");
@@ -104,14 +462,37 @@ static void __print_usage(const char *argv0)
 	printf("\n");
 }
 
+static int parse_ringbuffer_type(const char *name)
+{
+	for (int i = 0; i < nr_ringbuffer_types; i++)
+	{
+		if (strcmp(ringbuffer_type_names[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int parse_park_type(const char *name)
+{
+	for (int i = 0; i < nr_park_types; i++)
+	{
+		if (strcmp(park_type_names[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
 int parse_options(int argc, char *const argv[])
 {
 	char opt;
 	bool test_locks = false;
 	bool test_ringbuffer = false;
+	bool bench_locks = false;
+	bool bench_rings = false;
+	bool bench_processes = false;
 	enum lock_types lock_type = lock_spinlock;
 
-	while ((opt = getopt(argc, argv, "vqg:s:n:RrSml012h?")) != -1)
+	while ((opt = getopt(argc, argv, "vqg:s:b:B:cC:MG:OI:VXn:RrS:mlL:t:Tw:F:a:P:p012h?")) != -1)
 	{
 		switch (opt)
 		{
@@ -130,6 +511,50 @@ int parse_options(int argc, char *const argv[])
 		case 'R':
 			generator_type = generator_random;
 			break;
+		case 'b':
+			if (parse_ringbuffer_type(optarg) < 0)
+			{
+				fprintf(stderr, "Unknown ring buffer type %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			ringbuffer_type = parse_ringbuffer_type(optarg);
+			ringbuffer_type_given = true;
+			break;
+		case 'c':
+			bench_rings = true;
+			break;
+		case 'M':
+			use_mirror = true;
+			break;
+		case 'O':
+			use_lossy = true;
+			break;
+		case 'C':
+			nr_consumers = atoi(optarg);
+			break;
+		case 'I':
+			nr_sources = atoi(optarg);
+			break;
+		case 'G':
+			if (strcmp(optarg, "grow") == 0)
+				resize_flags = RINGBUFFER_GROWABLE;
+			else if (strcmp(optarg, "shrink") == 0)
+				resize_flags = RINGBUFFER_GROWABLE | RINGBUFFER_SHRINKABLE;
+			else
+			{
+				fprintf(stderr, "Unknown resize mode %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'V':
+			use_records = true;
+			break;
+		case 'X':
+			bench_processes = true;
+			break;
+		case 'B':
+			ring_batch = atoi(optarg);
+			break;
 		case 'g':
 			nr_generators = atoi(optarg);
 			break;
@@ -140,6 +565,81 @@ int parse_options(int argc, char *const argv[])
 			test_locks = true;
 			lock_type = lock_mutex;
 			break;
+		case 'L':
+			if (parse_lock_type(optarg) < 0)
+			{
+				fprintf(stderr, "Unknown lock type %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			test_locks = true;
+			lock_type = parse_lock_type(optarg);
+			break;
+		case 't':
+			nr_testers = atoi(optarg);
+			break;
+		case 'T':
+			bench_locks = true;
+			break;
+		case 'w':
+			if (sscanf(optarg, "%d:%d", &ttas_min_backoff, &ttas_max_backoff) != 2 ||
+					ttas_min_backoff <= 0 || ttas_min_backoff > ttas_max_backoff)
+			{
+				fprintf(stderr, "Invalid backoff window %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			test_semaphore(atoi(optarg));
+			exit(0);
+		case 'F':
+#ifdef CONFIG_FUTEX_MUTEX
+			fprintf(stderr, "The futex mutex always lets the waiters barge in, so -F is not supported\n");
+			return EXIT_FAILURE;
+#endif
+			if (strcmp(optarg, "fifo") == 0)
+			{
+				mutex_policy = mutex_fifo;
+			}
+			else if (strncmp(optarg, "barge", 5) == 0 &&
+					(optarg[5] == '\0' || optarg[5] == ':'))
+			{
+				mutex_policy = mutex_barging;
+				if (optarg[5] == ':')
+				{
+					char *end;
+					long usec;
+
+					errno = 0;
+					usec = strtol(optarg + 6, &end, 10);
+					if (errno || end == optarg + 6 || *end ||
+							usec < 0 || usec > UINT_MAX)
+					{
+						fprintf(stderr, "Invalid starvation window %s\n", optarg + 6);
+						return EXIT_FAILURE;
+					}
+					mutex_starvation_usec = usec;
+				}
+			}
+			else
+			{
+				fprintf(stderr, "Unknown mutex policy %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'a':
+			adaptive_spin_budget = atoi(optarg);
+			break;
+		case 'P':
+			if (parse_park_type(optarg) < 0)
+			{
+				fprintf(stderr, "Unknown parking backend %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			set_park_type(parse_park_type(optarg));
+			break;
+		case 'p':
+			bench_park();
+			exit(0);
 		case 's':
 			nr_slots = atoi(optarg);
 			break;
@@ -175,26 +675,103 @@ int parse_options(int argc, char *const argv[])
 		}
 	}
 
+	if (bench_rings)
+	{
+		bench_ringbuffer();
+		exit(0);
+	}
+	if (bench_processes)
+	{
+		bench_ipc();
+		exit(0);
+	}
 	if (!test_locks && !test_ringbuffer)
 	{
 		__print_usage(argv[0]);
 		return EXIT_FAILURE;
 	}
+	if (ring_batch < 1)
+	{
+		fprintf(stderr, "The batch size should be positive\n");
+		return EXIT_FAILURE;
+	}
+	if (ring_batch > nr_slots)
+	{
+		ring_batch = nr_slots;
+	}
+	if (use_lossy && (ringbuffer_type != ringbuffer_spin || use_mirror || resize_flags || use_records))
+	{
+		fprintf(stderr, "Only the spin ring without -M, -G, and -V can overwrite\n");
+		return EXIT_FAILURE;
+	}
+	if (nr_consumers < 1 || nr_consumers > MAX_CONSUMERS)
+	{
+		fprintf(stderr, "The number of counters should be in 1 -- %d\n", MAX_CONSUMERS);
+		return EXIT_FAILURE;
+	}
+	if (nr_consumers > 1 && ringbuffer_type != ringbuffer_broadcast)
+	{
+		fprintf(stderr, "Multiple counters need the bcast ring buffer\n");
+		return EXIT_FAILURE;
+	}
+	if (ringbuffer_type == ringbuffer_broadcast &&
+			(use_lossy || use_mirror || resize_flags || use_records || nr_sources > 1))
+	{
+		fprintf(stderr, "The bcast ring buffer does not work with -O, -M, -G, -V, and -I\n");
+		return EXIT_FAILURE;
+	}
+	if (nr_sources < 1)
+	{
+		fprintf(stderr, "The number of ring buffers should be positive\n");
+		return EXIT_FAILURE;
+	}
+	if (nr_sources > 1 && (ringbuffer_type == ringbuffer_shard || use_lossy || resize_flags || use_records))
+	{
+		fprintf(stderr, "Multiple ring buffers do not work with shard, -O, -G, and -V\n");
+		return EXIT_FAILURE;
+	}
+	if (!ringbuffer_type_given && !resize_flags && !use_lossy && nr_generators == nr_sources)
+	{
+		ringbuffer_type = ringbuffer_spsc;
+	}
+	if (ringbuffer_type == ringbuffer_spsc && nr_generators > nr_sources)
+	{
+		fprintf(stderr, "The spsc ring buffer allows only one generator\n");
+		return EXIT_FAILURE;
+	}
+	if (nr_testers < 1)
+	{
+		fprintf(stderr, "The number of testers should be positive\n");
+		return EXIT_FAILURE;
+	}
 	if (test_locks)
 	{
-		test_lock(lock_type);
+		if (bench_locks)
+			bench_lock(lock_type);
+		else
+			test_lock(lock_type);
 		exit(0);
 	}
 	return 0;
 }
 
-void compare_results(unsigned long generated_values[], unsigned long counted_values[])
+/**
+ * @nr_dropped values are allowed to be missing in @counted_values, while
+ * none may be counted more than generated.
+ */
+void compare_results(unsigned long generated_values[], unsigned long counted_values[],
+		unsigned long nr_dropped)
 {
 	bool mismatch = false;
+	unsigned long nr_missing = 0;
 
 	for (int i = MIN_VALUE; i < MAX_VALUE; i++)
 	{
-		if (generated_values[i] != counted_values[i])
+		if (generated_values[i] > counted_values[i])
+			nr_missing += generated_values[i] - counted_values[i];
+
+		if (generated_values[i] < counted_values[i] ||
+				(!nr_dropped && generated_values[i] != counted_values[i]))
 		{
 			if (!mismatch)
 			{
@@ -209,20 +786,284 @@ void compare_results(unsigned long generated_values[], unsigned long counted_val
 		}
 	}
 
+	if (nr_dropped)
+	{
+		fprintf(stderr, "      %lu values missing, %lu values dropped\n", nr_missing, nr_dropped);
+		if (nr_missing != nr_dropped)
+			mismatch = true;
+	}
+
 	printf("\n");
 	fprintf(stderr, ">>> The ring buffer is %sworking properly!! <<<\n", mismatch ? "**NOT** " : "");
 	printf("\n");
 }
 
+/*********************************************************************
+ * bench_ipc()
+ *
+ * Run the generators in child processes and the counter in this process,
+ * and pass the values through the shared-memory ring buffer, a pipe, and
+ * a Unix datagram socket in turn. The children report what they generated
+ * through an anonymous shared mapping.
+ */
+enum ipc_types {
+	ipc_shm = 0,
+	ipc_pipe,
+	ipc_socket,
+	nr_ipc_types,
+};
+
+static const char *ipc_type_names[] = {
+	[ipc_shm] = "shm",
+	[ipc_pipe] = "pipe",
+	[ipc_socket] = "socket",
+};
+
+struct ipc
+{
+	enum ipc_types type;
+	char name[32];
+	struct shm_ringbuffer *rb;
+	int fds[2];
+};
+
+static int __ipc_open(struct ipc *ipc, enum ipc_types type)
+{
+	ipc->type = type;
+	switch (type)
+	{
+	case ipc_shm:
+		snprintf(ipc->name, sizeof(ipc->name), "/lock-ring-%d", getpid());
+		ipc->rb = shm_ringbuffer_create(ipc->name, nr_slots);
+		return ipc->rb ? 0 : -errno;
+	case ipc_pipe:
+		return pipe(ipc->fds) ? -errno : 0;
+	case ipc_socket:
+		return socketpair(AF_UNIX, SOCK_DGRAM, 0, ipc->fds) ? -errno : 0;
+	default:
+		assert(0);
+	}
+	return -EINVAL;
+}
+
+static void __ipc_close(struct ipc *ipc)
+{
+	if (ipc->type == ipc_shm)
+	{
+		shm_ringbuffer_close(ipc->rb);
+		shm_ringbuffer_unlink(ipc->name);
+	}
+	else
+	{
+		close(ipc->fds[0]);
+		close(ipc->fds[1]);
+	}
+}
+
+static void __ipc_send(struct ipc *ipc, int value)
+{
+	if (ipc->type == ipc_shm)
+	{
+		enqueue_into_shm_ringbuffer(ipc->rb, value);
+		return;
+	}
+	/* A write of an int is atomic to pipes and datagram sockets */
+	while (write(ipc->fds[1], &value, sizeof(value)) != sizeof(value))
+		assert(errno == EINTR);
+}
+
+/* Wait for a value for IPC_RECV_TIMEOUT_MSEC at most. Return -ETIMEDOUT then */
+#define IPC_RECV_TIMEOUT_MSEC 100
+
+static int __ipc_recv(struct ipc *ipc, int *value)
+{
+	struct pollfd pfd = {.fd = ipc->fds[0], .events = POLLIN};
+	struct timespec deadline;
+	int ret;
+
+	if (ipc->type == ipc_shm)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += IPC_RECV_TIMEOUT_MSEC * 1000000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+		return dequeue_from_shm_ringbuffer_until(ipc->rb, value, &deadline);
+	}
+
+	while (1)
+	{
+		ret = poll(&pfd, 1, IPC_RECV_TIMEOUT_MSEC);
+		if (ret == 0)
+			return -ETIMEDOUT;
+		if (ret > 0 && read(ipc->fds[0], value, sizeof(*value)) == sizeof(*value))
+			return 0;
+		assert(errno == EINTR);
+	}
+}
+
+/**
+ * Reap the generators that have exited so far, and clear their pids in
+ * @pids. Return false if any of them has failed.
+ */
+static bool __ipc_reap(pid_t pids[], int *nr_alive)
+{
+	bool succeeded = true;
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		for (int i = 0; i < nr_generators; i++)
+		{
+			if (pids[i] == pid)
+				pids[i] = 0;
+		}
+		(*nr_alive)--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			succeeded = false;
+	}
+	return succeeded;
+}
+
+static void __ipc_generate(struct ipc *ipc, unsigned long generated[])
+{
+	/* Attach to the ring by its name as an unrelated process would do */
+	if (ipc->type == ipc_shm)
+	{
+		ipc->rb = shm_ringbuffer_open(ipc->name);
+		if (!ipc->rb)
+			_exit(EXIT_FAILURE);
+	}
+
+	srandom(getpid());
+	for (unsigned long i = 0; i < nr_generate; i++)
+	{
+		int value = MIN_VALUE + random() % (MAX_VALUE - MIN_VALUE);
+
+		__ipc_send(ipc, value);
+		generated[value]++;
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void bench_ipc(void)
+{
+	unsigned long nr_requests = nr_generate * nr_generators;
+	unsigned long(*generated)[MAX_VALUE];
+	unsigned long generated_values[MAX_VALUE];
+	unsigned long counted_values[MAX_VALUE];
+	unsigned long elapsed[nr_ipc_types];
+	struct timeval start, end;
+	struct ipc ipc;
+	int err;
+	pid_t pids[nr_generators];
+	int nr_alive;
+	bool failed;
+	int value;
+
+	generated = mmap(NULL, sizeof(*generated) * nr_generators,
+									 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(generated != MAP_FAILED);
+
+	for (int t = 0; t < nr_ipc_types; t++)
+	{
+		elapsed[t] = 0;
+		if ((err = __ipc_open(&ipc, t)))
+		{
+			fprintf(stderr, "Cannot open %s: %s\n", ipc_type_names[t], strerror(-err));
+			continue;
+		}
+		bzero(generated, sizeof(*generated) * nr_generators);
+		bzero(counted_values, sizeof(counted_values));
+
+		gettimeofday(&start, NULL);
+		failed = false;
+		nr_alive = 0;
+		for (int i = 0; i < nr_generators; i++)
+		{
+			pids[i] = fork();
+			if (pids[i] == 0)
+				__ipc_generate(&ipc, generated[i]);
+			if (pids[i] < 0)
+			{
+				fprintf(stderr, "Cannot fork generator %d: %s\n", i, strerror(errno));
+				pids[i] = 0;
+				failed = true;
+				break;
+			}
+			nr_alive++;
+		}
+
+		for (unsigned long i = 0; !failed && i < nr_requests;)
+		{
+			if (__ipc_recv(&ipc, &value) == 0)
+			{
+				counted_values[value]++;
+				i++;
+				continue;
+			}
+			/**
+			 * Nothing arrived for a while. Give up if a generator has failed,
+			 * or if all of them had already exited before the wait.
+			 */
+			if (!nr_alive || !__ipc_reap(pids, &nr_alive))
+			{
+				fprintf(stderr, "Generators exited after sending %lu / %lu values\n",
+								i, nr_requests);
+				failed = true;
+			}
+		}
+
+		if (failed)
+		{
+			for (int i = 0; i < nr_generators; i++)
+			{
+				if (pids[i] > 0)
+					kill(pids[i], SIGKILL);
+			}
+		}
+		while (wait(NULL) > 0)
+			;
+		gettimeofday(&end, NULL);
+		elapsed[t] = (end.tv_sec * 1000000 + end.tv_usec) -
+								 (start.tv_sec * 1000000 + start.tv_usec);
+		__ipc_close(&ipc);
+		if (failed)
+		{
+			elapsed[t] = 0;
+			continue;
+		}
+
+		bzero(generated_values, sizeof(generated_values));
+		for (int i = 0; i < nr_generators; i++)
+		{
+			for (int v = MIN_VALUE; v < MAX_VALUE; v++)
+				generated_values[v] += generated[i][v];
+		}
+		compare_results(generated_values, counted_values, 0);
+	}
+	munmap(generated, sizeof(*generated) * nr_generators);
+
+	fprintf(stderr, "  %-6s %14s\n", "ipc", "req/sec");
+	for (int t = 0; t < nr_ipc_types; t++)
+	{
+		fprintf(stderr, "  %-6s %14lu\n", ipc_type_names[t],
+						elapsed[t] ? nr_requests * 1000000 / elapsed[t] : 0);
+	}
+}
+
 int main(int argc, char *const argv[])
 {
 	int retval = EXIT_SUCCESS;
 	unsigned long generated_values[MAX_VALUE] = {0};
-	unsigned long counted_values[MAX_VALUE] = {0};
+	unsigned long counted_values[MAX_CONSUMERS][MAX_VALUE] = {{0}};
 	unsigned long nr_requests_to_generate;
 
 	struct timeval start, end;
 	unsigned long elapsed;
+	struct rusage usage;
+	unsigned long cpu_usec;
+	unsigned long start_usec, end_usec;
 
 	__print_message("\n");
 	__print_message(" _               _      _____         _            \n");
@@ -244,6 +1085,7 @@ int main(int argc, char *const argv[])
 	}
 
 	nr_requests_to_generate = nr_generate * nr_generators;
+	start_usec = __monotonic_usec();
 
 	if ((retval = spawn_counter(counter_type, nr_requests_to_generate)))
 	{
@@ -260,12 +1102,28 @@ int main(int argc, char *const argv[])
 
 	fini_generators(generated_values);
 	fini_counter(counted_values);
+	end_usec = __monotonic_usec();
 
-	compare_results(generated_values, counted_values);
+	for (int i = 0; i < nr_consumers; i++)
+	{
+		if (nr_consumers > 1)
+			fprintf(stderr, "         Counter %2d:\n", i);
+		compare_results(generated_values, counted_values[i], __dropped_rb());
+	}
 	printf("     # of requests : %lu\n", nr_requests_to_generate);
 	printf("  Time to complete : %lu.%06lu\n", elapsed / 1000000, elapsed % 1000000);
 	fprintf(stderr, "       Performance : %lu req/sec\n",
 					nr_requests_to_generate * 1000000 / elapsed);
+
+	getrusage(RUSAGE_SELF, &usage);
+	cpu_usec = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+						 usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+	fprintf(stderr, "          CPU time : %lu.%06lu sec (%s ring)\n",
+					cpu_usec / 1000000, cpu_usec % 1000000,
+					use_records ? "record" : ringbuffer_type_names[ringbuffer_type]);
+	__report_shards();
+	__report_drops();
+	__report_resizes(start_usec, end_usec, nr_requests_to_generate);
 	printf("\n");
 
 exit_ring:
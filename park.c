@@ -0,0 +1,240 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdint.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+
+#include "types.h"
+#include "atomic.h"
+#include "park.h"
+
+/*********************************************************************
+ * Thread parking
+ *
+ * park() puts the calling thread into sleep until some other thread calls
+ * unpark() for it. Every unpark() pairs with exactly one park(); unpark()
+ * may come before the matching park(), in which case park() returns right
+ * away. So the waker never has to care whether the wakee is already asleep.
+ *
+ * Each thread has its own parker, which is set up lazily on its first
+ * self_parker() call with the backend selected by set_park_type().
+ *
+ * - park_signal  : Queue a real-time signal to the thread, and receive it
+ *                  through a per-thread signalfd.
+ * - park_futex   : Count the permits in a word and sleep on it with futex.
+ * - park_eventfd : Per-thread eventfd in the semaphore mode.
+ * - park_pipe    : Per-thread pipe. Write and read one byte per permit.
+ *********************************************************************/
+const char *park_type_names[] = {
+	[park_signal] = "signal",
+	[park_futex] = "futex",
+	[park_eventfd] = "eventfd",
+	[park_pipe] = "pipe",
+};
+
+struct parker
+{
+	enum park_types type;
+	bool initialized;
+	pthread_t pthread;
+	int permits;	/* park_futex */
+	int fd[2];		/* signalfd, eventfd, or the ends of the pipe */
+};
+
+static enum park_types park_type = park_signal;
+
+static __thread struct parker parker = {};
+
+static pthread_key_t parker_key;
+static pthread_once_t parker_key_once = PTHREAD_ONCE_INIT;
+
+#define PARK_SIGNAL (SIGRTMIN + 1)
+
+void set_park_type(const enum park_types type)
+{
+	assert(type >= 0 && type < nr_park_types);
+	park_type = type;
+}
+
+enum park_types get_park_type(void)
+{
+	return park_type;
+}
+
+static void __fini_parker(void *_parker_)
+{
+	struct parker *p = _parker_;
+
+	if (!p->initialized)
+		return;
+
+	switch (p->type)
+	{
+	case park_signal:
+	case park_eventfd:
+		close(p->fd[0]);
+		break;
+	case park_pipe:
+		close(p->fd[0]);
+		close(p->fd[1]);
+		break;
+	default:
+		break;
+	}
+	p->initialized = false;
+}
+
+static void __create_parker_key(void)
+{
+	pthread_key_create(&parker_key, __fini_parker);
+}
+
+static void __init_parker(struct parker *p)
+{
+	sigset_t mask;
+	int ret;
+
+	pthread_once(&parker_key_once, __create_parker_key);
+	__fini_parker(p);
+
+	p->type = park_type;
+	p->pthread = pthread_self();
+	p->permits = 0;
+
+	switch (p->type)
+	{
+	case park_signal:
+		/* Keep the signal pending until we read it from the signalfd */
+		sigemptyset(&mask);
+		sigaddset(&mask, PARK_SIGNAL);
+		pthread_sigmask(SIG_BLOCK, &mask, NULL);
+		p->fd[0] = signalfd(-1, &mask, SFD_CLOEXEC);
+		assert(p->fd[0] >= 0);
+		break;
+	case park_futex:
+		break;
+	case park_eventfd:
+		p->fd[0] = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+		assert(p->fd[0] >= 0);
+		break;
+	case park_pipe:
+		ret = pipe(p->fd);
+		assert(ret == 0);
+		break;
+	default:
+		assert(0);
+	}
+
+	p->initialized = true;
+	pthread_setspecific(parker_key, p);
+}
+
+struct parker *self_parker(void)
+{
+	if (!parker.initialized || parker.type != park_type)
+		__init_parker(&parker);
+
+	return &parker;
+}
+
+static inline long __futex(int *uaddr, int op, int val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/* Retry the blocking read/write until it goes through */
+static void __read_fd(int fd, void *buf, size_t len)
+{
+	while (read(fd, buf, len) != len)
+		assert(errno == EINTR);
+}
+
+static void __write_fd(int fd, const void *buf, size_t len)
+{
+	while (write(fd, buf, len) != len)
+		assert(errno == EINTR);
+}
+
+void park(struct parker *p)
+{
+	struct signalfd_siginfo info;
+	uint64_t count;
+	char byte;
+	int c;
+
+	switch (p->type)
+	{
+	case park_signal:
+		__read_fd(p->fd[0], &info, sizeof(info));
+		break;
+	case park_futex:
+		while (1)
+		{
+			c = ACCESS_ONCE(p->permits);
+			if (c > 0 && compare_and_swap(&p->permits, c, c - 1) == c)
+				break;
+			if (c == 0)
+				__futex(&p->permits, FUTEX_WAIT_PRIVATE, 0);
+		}
+		break;
+	case park_eventfd:
+		__read_fd(p->fd[0], &count, sizeof(count));
+		break;
+	case park_pipe:
+		__read_fd(p->fd[0], &byte, sizeof(byte));
+		break;
+	default:
+		assert(0);
+	}
+}
+
+void unpark(struct parker *p)
+{
+	uint64_t count = 1;
+	char byte = 0;
+	union sigval value = { .sival_int = 0 };
+
+	switch (p->type)
+	{
+	case park_signal:
+		pthread_sigqueue(p->pthread, PARK_SIGNAL, value);
+		break;
+	case park_futex:
+		fetch_and_add(&p->permits, 1);
+		__futex(&p->permits, FUTEX_WAKE_PRIVATE, 1);
+		break;
+	case park_eventfd:
+		__write_fd(p->fd[0], &count, sizeof(count));
+		break;
+	case park_pipe:
+		__write_fd(p->fd[1], &byte, sizeof(byte));
+		break;
+	default:
+		assert(0);
+	}
+}
@@ -0,0 +1,38 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __PARK_H__
+#define __PARK_H__
+
+enum park_types {
+	park_signal = 0,
+	park_futex,
+	park_eventfd,
+	park_pipe,
+	nr_park_types,
+};
+
+extern const char *park_type_names[];
+
+struct parker;
+
+void set_park_type(const enum park_types);
+enum park_types get_park_type(void);
+
+struct parker *self_parker(void);
+void park(struct parker *);
+void unpark(struct parker *);
+
+#endif
@@ -0,0 +1,124 @@
+/**********************************************************************
+ * Copyright (c) 2020
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include <time.h>
+
+enum ringbuffer_types {
+	ringbuffer_spin = 0,
+	ringbuffer_sem,
+	ringbuffer_spsc,
+	ringbuffer_mpmc,
+	ringbuffer_mask,
+	ringbuffer_shard,
+	ringbuffer_broadcast,
+	nr_ringbuffer_types,
+};
+
+/* The low bits of the flags to ringbuffer_create() select the type */
+#define RINGBUFFER_TYPE_MASK 0xff
+
+/* Map the slots twice back to back for wrap-free bulk operations */
+#define RINGBUFFER_MIRRORED 0x100
+
+/* Let ringbuffer_spin grow when full, and shrink back when mostly empty */
+#define RINGBUFFER_GROWABLE 0x200
+#define RINGBUFFER_SHRINKABLE 0x400
+
+/* The number of resize events logged per ring buffer */
+#define RINGBUFFER_MAX_EVENTS 64
+
+struct ringbuffer_resize_event {
+	unsigned long usec;				/* When it happened on CLOCK_MONOTONIC */
+	int nr_slots;							/* The number of slots after the event */
+	unsigned long nr_values;	/* The values dequeued before the event */
+};
+
+/*************************************************
+ * Ring buffer
+ */
+struct ringbuffer;
+struct ringbuffer *ringbuffer_create(const int nr_slots, unsigned int flags);
+struct ringbuffer *ringbuffer_create_sharded(const int nr_slots, const int nr_shards);
+void ringbuffer_destroy(struct ringbuffer *);
+
+void enqueue_into_ringbuffer(struct ringbuffer *, int value);
+int dequeue_from_ringbuffer(struct ringbuffer *);
+
+int try_enqueue_into_ringbuffer(struct ringbuffer *, int value);
+int try_dequeue_from_ringbuffer(struct ringbuffer *, int *value);
+int enqueue_into_ringbuffer_until(struct ringbuffer *, int value, const struct timespec *deadline);
+int dequeue_from_ringbuffer_until(struct ringbuffer *, int *value, const struct timespec *deadline);
+
+int enqueue_bulk_into_ringbuffer(struct ringbuffer *, const int *values, const int n);
+int enqueue_burst_into_ringbuffer(struct ringbuffer *, const int *values, const int n);
+int dequeue_bulk_from_ringbuffer(struct ringbuffer *, int *values, const int n);
+int dequeue_burst_from_ringbuffer(struct ringbuffer *, int *values, const int max);
+
+int get_resize_events(struct ringbuffer *, struct ringbuffer_resize_event *events, const int max);
+unsigned long get_nr_resizes(struct ringbuffer *);
+
+/*************************************************
+ * Sharded ring buffer
+ */
+void enqueue_into_shard(struct ringbuffer *, const int shard, int value);
+int enqueue_bulk_into_shard(struct ringbuffer *, const int shard, const int *values, const int n);
+int get_shard_stat(struct ringbuffer *, const int shard, unsigned long *nr_values, unsigned long *usec);
+
+/*************************************************
+ * Broadcast ring buffer
+ */
+struct ringbuffer *ringbuffer_create_broadcast(const int nr_slots, const int nr_consumers);
+int dequeue_for_consumer(struct ringbuffer *, const int consumer);
+int dequeue_burst_for_consumer(struct ringbuffer *, const int consumer, int *values, const int max);
+
+/*************************************************
+ * Lossy ring buffer
+ */
+struct ringbuffer *ringbuffer_create_lossy(const int nr_slots, const int nr_producers);
+void overwrite_into_ringbuffer(struct ringbuffer *, const int producer, int value);
+int overwrite_bulk_into_ringbuffer(struct ringbuffer *, const int producer, const int *values, const int n);
+int get_drop_stat(struct ringbuffer *, const int producer, unsigned long *nr_dropped);
+unsigned long get_nr_dropped(struct ringbuffer *);
+
+/*************************************************
+ * Variable-length record ring
+ */
+struct record_ring;
+struct record_ring *record_ring_create(const size_t capacity);
+size_t record_ring_min_capacity(const size_t len);
+void record_ring_destroy(struct record_ring *);
+
+void *reserve_record(struct record_ring *, const size_t len);
+void commit_record(struct record_ring *, void *record);
+void *peek_record(struct record_ring *, size_t *len);
+void release_record(struct record_ring *);
+
+/*************************************************
+ * Shared-memory ring buffer
+ */
+struct shm_ringbuffer;
+struct shm_ringbuffer *shm_ringbuffer_create(const char *name, const int nr_slots);
+struct shm_ringbuffer *shm_ringbuffer_open(const char *name);
+void shm_ringbuffer_close(struct shm_ringbuffer *);
+int shm_ringbuffer_unlink(const char *name);
+
+void enqueue_into_shm_ringbuffer(struct shm_ringbuffer *, int value);
+int dequeue_from_shm_ringbuffer(struct shm_ringbuffer *);
+int dequeue_from_shm_ringbuffer_until(struct shm_ringbuffer *, int *value, const struct timespec *deadline);
+
+#endif
@@ -19,9 +19,13 @@
 #include <pthread.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <string.h>
+#include <time.h>
 
 #include "types.h"
 #include "locks.h"
+#include "atomic.h"
+#include "park.h"
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -33,59 +37,225 @@ static int testlock_held = 0;
 static enum lock_types lock_type;
 
 static unsigned long nr_tested = 0;
+
+/**
+ * Per-tester statistics, updated while holding the lock under test. Keep
+ * each on its own cache line so that the testers do not bounce the line
+ * of their neighbours and skew the numbers they report.
+ */
+struct tester_stat
+{
+	unsigned long nr_acquired;
+	unsigned long max_wait_nsec;
+} __attribute__((aligned(CACHELINE_SIZE)));
+
+static struct tester_stat *tester_stats = NULL;
+
+static void __alloc_tester_stats(void)
+{
+	int ret = posix_memalign((void **)&tester_stats, CACHELINE_SIZE,
+			sizeof(*tester_stats) * nr_testers);
+
+	assert(ret == 0);
+	memset(tester_stats, 0x00, sizeof(*tester_stats) * nr_testers);
+}
+
+/**
+ * The program is linked with --wrap=malloc so that every malloc() call
+ * from our objects goes through here. Used to check that the locks do not
+ * allocate memory on their acquisition path.
+ */
+static int nr_mallocs = 0;
+
+void *__real_malloc(size_t size);
+void *__wrap_malloc(size_t size)
+{
+	fetch_and_add(&nr_mallocs, 1);
+	return __real_malloc(size);
+}
 static int testing_duration_sec = 5;
 
-const int nr_testers = 4;
+int nr_testers = 4;
+
+/* Backoff window of the TTAS spinlock in pause iterations */
+int ttas_min_backoff = 4;
+int ttas_max_backoff = 1024;
+
+/* How the mutex is passed on to its waiters */
+enum mutex_policies mutex_policy = mutex_fifo;
+unsigned int mutex_starvation_usec = 1000;
+
+/* Polling iterations of the adaptive mutex before parking */
+int adaptive_spin_budget = 100;
 
 /* Wrapper functions to locks */
-static inline const char *__lock_type(void)
+static const char *lock_names[] = {
+	[lock_spinlock] = "spinlock",
+	[lock_mutex] = "mutex",
+	[lock_semaphore] = "semaphore",
+	[lock_ticket] = "ticket",
+	[lock_mcs] = "mcs",
+	[lock_clh] = "clh",
+	[lock_ttas] = "ttas",
+	[lock_rwspinlock] = "rwspinlock",
+	[lock_adaptive] = "adaptive",
+};
+
+int parse_lock_type(const char *name)
 {
-	if (lock_type == lock_spinlock)
+	for (int i = 0; i < sizeof(lock_names) / sizeof(lock_names[0]); i++)
 	{
-		return "spinlock";
+		if (lock_names[i] && strcmp(lock_names[i], name) == 0)
+			return i;
 	}
-	else if (lock_type == lock_mutex)
+	return -1;
+}
+
+static inline const char *__lock_type(void)
+{
+	return lock_names[lock_type];
+}
+
+static inline bool __lock_is_spinning(void)
+{
+	switch (lock_type)
 	{
-		return "mutex";
+	case lock_spinlock:
+	case lock_ticket:
+	case lock_mcs:
+	case lock_clh:
+	case lock_ttas:
+	case lock_rwspinlock:
+		return true;
+	default:
+		return false;
 	}
 }
 
 static inline void __lock(void)
 {
-	if (lock_type == lock_spinlock)
+	switch (lock_type)
 	{
+	case lock_spinlock:
 		acquire_spinlock(testlock);
-	}
-	else if (lock_type == lock_mutex)
-	{
+		break;
+	case lock_mutex:
 		acquire_mutex(testlock);
+		break;
+	case lock_adaptive:
+		acquire_adaptive_mutex(testlock);
+		break;
+	case lock_semaphore:
+		down(testlock);
+		break;
+	case lock_ticket:
+		acquire_ticket_spinlock(testlock);
+		break;
+	case lock_mcs:
+		acquire_mcs_spinlock(testlock);
+		break;
+	case lock_clh:
+		acquire_clh_spinlock(testlock);
+		break;
+	case lock_ttas:
+		acquire_ttas_spinlock(testlock);
+		break;
+	case lock_rwspinlock:
+		acquire_write(testlock);
+		break;
+	default:
+		assert(0);
 	}
 }
 
 static inline void __unlock(void)
 {
-	if (lock_type == lock_spinlock)
+	switch (lock_type)
 	{
+	case lock_spinlock:
 		release_spinlock(testlock);
-	}
-	else if (lock_type == lock_mutex)
-	{
+		break;
+	case lock_mutex:
 		release_mutex(testlock);
+		break;
+	case lock_adaptive:
+		release_adaptive_mutex(testlock);
+		break;
+	case lock_semaphore:
+		up(testlock);
+		break;
+	case lock_ticket:
+		release_ticket_spinlock(testlock);
+		break;
+	case lock_mcs:
+		release_mcs_spinlock(testlock);
+		break;
+	case lock_clh:
+		release_clh_spinlock(testlock);
+		break;
+	case lock_ttas:
+		release_ttas_spinlock(testlock);
+		break;
+	case lock_rwspinlock:
+		release_write(testlock);
+		break;
+	default:
+		assert(0);
 	}
 }
 
 static inline void __init_lock(void)
 {
-	if (lock_type == lock_spinlock)
+	switch (lock_type)
 	{
+	case lock_spinlock:
 		init_spinlock(testlock);
-	}
-	else if (lock_type == lock_mutex)
-	{
+		break;
+	case lock_mutex:
 		init_mutex(testlock);
+		set_mutex_policy(testlock, mutex_policy, mutex_starvation_usec);
+		break;
+	case lock_adaptive:
+		init_adaptive_mutex(testlock, adaptive_spin_budget);
+		break;
+	case lock_semaphore:
+		/* A binary semaphore works as a mutex */
+		init_semaphore(testlock, 1);
+		break;
+	case lock_ticket:
+		init_ticket_spinlock(testlock);
+		break;
+	case lock_mcs:
+		init_mcs_spinlock(testlock);
+		break;
+	case lock_clh:
+		init_clh_spinlock(testlock);
+		break;
+	case lock_ttas:
+		init_ttas_spinlock(testlock, ttas_min_backoff, ttas_max_backoff);
+		break;
+	case lock_rwspinlock:
+		init_rwspinlock(testlock);
+		break;
+	default:
+		assert(0);
 	}
 }
 
+/* Release what __init_lock() has allocated. Only the CLH lock has any */
+static inline void __fini_lock(void)
+{
+	if (lock_type == lock_clh)
+		fini_clh_spinlock(testlock);
+}
+
+static inline unsigned long __now_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
 static int hold_duration_usec = 0;
 static int progress = 0;
 static bool lock_in_order = true;
@@ -99,7 +269,11 @@ static void *test_thread(void *_arg_)
 	/* Doing test #1 to #4 */
 	while (keep_testing)
 	{
+		unsigned long start = __now_nsec();
+
 		__lock();
+		if (__now_nsec() - start > tester_stats[id].max_wait_nsec)
+			tester_stats[id].max_wait_nsec = __now_nsec() - start;
 
 		assert(testlock_held == 0);
 		testlock_held = 1;
@@ -107,6 +281,7 @@ static void *test_thread(void *_arg_)
 			usleep(hold_duration_usec);
 
 		nr_tested++;
+		tester_stats[id].nr_acquired++;
 
 		assert(testlock_held == 1);
 		testlock_held = 0;
@@ -150,6 +325,41 @@ static bool is_busywaiting(void)
 	return usage.ru_utime.tv_sec > testing_duration_sec;
 }
 
+/**
+ * Summarize how evenly the lock was granted to the testers. Jain's index
+ * is 1.0 when every tester got the same share and 1/n when one tester
+ * monopolized the lock.
+ */
+static void report_fairness(void)
+{
+	unsigned long min = ~0UL, max = 0, max_wait = 0;
+	double sum = 0, sum_sq = 0;
+
+	for (int i = 0; i < nr_testers; i++)
+	{
+		unsigned long n = tester_stats[i].nr_acquired;
+		if (tester_stats[i].max_wait_nsec > max_wait)
+			max_wait = tester_stats[i].max_wait_nsec;
+		if (n < min)
+			min = n;
+		if (n > max)
+			max = n;
+		sum += n;
+		sum_sq += (double)n * n;
+	}
+	fprintf(stderr, "   Fairness: %lu - %lu acquisitions per thread (Jain's index %.3f)\n",
+					min, max, sum_sq ? sum * sum / (nr_testers * sum_sq) : 1.0);
+	fprintf(stderr, "   Max wait: %lu usec\n", max_wait / 1000);
+	if (lock_type == lock_mutex)
+	{
+#ifdef CONFIG_FUTEX_MUTEX
+		fprintf(stderr, "   Policy: barging (futex)\n");
+#else
+		fprintf(stderr, "   Policy: %s\n", mutex_policy == mutex_fifo ? "fifo" : "barging");
+#endif
+	}
+}
+
 void test_lock(enum lock_types _lock_type_)
 {
 	pthread_t tester[nr_testers];
@@ -157,6 +367,8 @@ void test_lock(enum lock_types _lock_type_)
 	int temp = 0;
 	lock_type = _lock_type_;
 	bool ret = false;
+	struct rusage usage_start, usage_end;
+	unsigned long spin_acquired = 0;
 
 	__print_message("0. Testing '%s'\n", __lock_type());
 
@@ -167,6 +379,8 @@ void test_lock(enum lock_types _lock_type_)
 	testlock = malloc(4096);
 	__init_lock();
 
+	__alloc_tester_stats();
+
 	/*********************************************************
 	 * Check the mutual exclusive property.
 	 * 1. The main thread graps the lock.
@@ -195,14 +409,41 @@ void test_lock(enum lock_types _lock_type_)
 	 * Testing threads keep torturing the lock for @testing_duration_sec.
 	 */
 	__print_message("2. Verify the mutual exclusiveness further");
+	ACCESS_ONCE(nr_mallocs) = 0;
+	for (int i = 0; i < nr_testers; i++)
+	{
+		ACCESS_ONCE(tester_stats[i].max_wait_nsec) = 0;
+	}
+	getrusage(RUSAGE_SELF, &usage_start);
+	if (lock_type == lock_adaptive)
+		spin_acquired = adaptive_mutex_spin_acquired(testlock);
 	for (int i = 0; i < testing_duration_sec; i++)
 	{
 		sleep(1);
 		__print_message(".");
 	}
+	getrusage(RUSAGE_SELF, &usage_end);
+	if (lock_type == lock_adaptive)
+		spin_acquired = adaptive_mutex_spin_acquired(testlock) - spin_acquired;
 	__print_message("  [Done]\n");
 	fprintf(stderr, "   Performance: %lu operations/sec\n",
 					nr_tested / testing_duration_sec);
+	if (lock_type == lock_ttas)
+	{
+		fprintf(stderr, "   Backoff: %d - %d pause iterations\n",
+						ttas_min_backoff, ttas_max_backoff);
+	}
+	report_fairness();
+	fprintf(stderr, "   Allocations: %.3f per acquisition\n",
+					nr_tested ? (double)ACCESS_ONCE(nr_mallocs) / nr_tested : 0.0);
+	fprintf(stderr, "   Context switches: %ld/sec\n",
+					((usage_end.ru_nvcsw + usage_end.ru_nivcsw) -
+					 (usage_start.ru_nvcsw + usage_start.ru_nivcsw)) / testing_duration_sec);
+	if (lock_type == lock_adaptive)
+	{
+		fprintf(stderr, "   Context switches avoided: %lu/sec (spin budget %d)\n",
+						spin_acquired / testing_duration_sec, adaptive_spin_budget);
+	}
 
 	/*********************************************************
 	 * Testing possible-race condition.
@@ -223,8 +464,7 @@ void test_lock(enum lock_types _lock_type_)
 	__print_message("             [Done]\n");
 	fprintf(stderr, "   Seem to be a %s lock\n",
 					ret ? "busy-waiting" : "blocking");
-	assert((lock_type == lock_spinlock && ret == true) ||
-				 (lock_type == lock_mutex && ret == false));
+	assert(ret == __lock_is_spinning());
 
 	keep_testing = false;
 
@@ -240,7 +480,8 @@ void test_lock(enum lock_types _lock_type_)
 		pthread_join(tester[i], NULL);
 	}
 	assert(testlock_held == 0);
-	if (lock_type == lock_spinlock || (lock_type == lock_mutex && lock_in_order))
+	__fini_lock();
+	if (__lock_is_spinning() || lock_in_order)
 	{
 		fprintf(stderr, "\n >>>> Congraturations! Your %s implementation looks great!! <<<<\n\n", __lock_type());
 	}
@@ -251,3 +492,456 @@ void test_lock(enum lock_types _lock_type_)
 
 	return;
 }
+
+/*********************************************************************
+ * Counting semaphore tester.
+ * Threads keep taking one or two units of the semaphore initialized with
+ * @S, sometimes with try_down(), while checking that no more than @S units
+ * are taken at any moment.
+ */
+static int nr_units_taken = 0;
+static int sem_value;
+
+static void *test_semaphore_thread(void *_arg_)
+{
+	long id = (long)_arg_;
+	int max_taken = 0;
+
+	pthread_barrier_wait(&barrier);
+	for (unsigned long i = 0; ACCESS_ONCE(keep_testing); i++)
+	{
+		int n = (sem_value > 1 && i % 4 == 3) ? 2 : 1;
+		int taken;
+
+		if (i % 8 == 5)
+		{
+			if (!try_down(testlock))
+				continue;
+			n = 1;
+		}
+		else
+		{
+			down_n(testlock, n);
+		}
+
+		taken = fetch_and_add(&nr_units_taken, n) + n;
+		assert(taken <= sem_value);
+		if (taken > max_taken)
+			max_taken = taken;
+		tester_stats[id].nr_acquired++;
+
+		/* Stay a while sometimes so that the others pile up */
+		if (i % 64 == 0)
+			usleep(100);
+
+		fetch_and_add(&nr_units_taken, -n);
+		up_n(testlock, n);
+	}
+
+	return (void *)(long)max_taken;
+}
+
+void test_semaphore(const int S)
+{
+	pthread_t tester[nr_testers];
+	unsigned long total = 0;
+	int max_taken = 0;
+
+	__print_message("0. Testing 'semaphore' with S=%d\n", S);
+	assert(S > 0);
+
+	sem_value = S;
+	lock_type = lock_semaphore;
+	testlock = malloc(4096);
+	init_semaphore(testlock, S);
+	__alloc_tester_stats();
+
+	__print_message("1. Torture the semaphore with %d threads", nr_testers);
+	keep_testing = true;
+	pthread_barrier_init(&barrier, NULL, nr_testers + 1);
+	for (long i = 0; i < nr_testers; i++)
+	{
+		pthread_create(tester + i, NULL, test_semaphore_thread, (void *)i);
+	}
+	pthread_barrier_wait(&barrier);
+	for (int i = 0; i < testing_duration_sec; i++)
+	{
+		sleep(1);
+		__print_message(".");
+	}
+	ACCESS_ONCE(keep_testing) = false;
+
+	for (int i = 0; i < nr_testers; i++)
+	{
+		void *ret;
+		pthread_join(tester[i], &ret);
+		if ((long)ret > max_taken)
+			max_taken = (long)ret;
+		total += tester_stats[i].nr_acquired;
+	}
+	__print_message("  [Done]\n");
+	fprintf(stderr, "   Performance: %lu operations/sec\n", total / testing_duration_sec);
+	fprintf(stderr, "   Units taken at once: up to %d / %d\n", max_taken, S);
+
+	__print_message("2. Check the semaphore value after all.......");
+	for (int i = 0; i < S; i++)
+	{
+		assert(try_down(testlock));
+	}
+	assert(!try_down(testlock));
+	up_n(testlock, S);
+	__print_message("  [Done]\n");
+
+	fprintf(stderr, "\n >>>> Congraturations! Your semaphore implementation looks great!! <<<<\n\n");
+
+	pthread_barrier_destroy(&barrier);
+	free(tester_stats);
+	free(testlock);
+}
+
+/*********************************************************************
+ * Lock benchmark.
+ * Measure the lock throughput with 1 to @nr_testers threads and put it
+ * side by side with the baseline lock of the same kind (i.e., the CAS
+ * spinlock for spinning locks, and the signal-based mutex for blocking
+ * ones).
+ */
+static int bench_duration_msec = 1000;
+static bool keep_benching;
+
+/* Protected by the lock under benchmark */
+static unsigned long *last_holder;
+static unsigned long last_released_nsec;
+static unsigned long handoff_nsec;
+static unsigned long nr_handoffs;
+
+/* One per thread, on its own cache line as struct tester_stat */
+struct bench_stat
+{
+	unsigned long nr_ops;
+	unsigned long max_wait_nsec;
+} __attribute__((aligned(CACHELINE_SIZE)));
+
+static void *bench_thread(void *_arg_)
+{
+	struct bench_stat *stat = _arg_;
+
+	pthread_barrier_wait(&barrier);
+	while (ACCESS_ONCE(keep_benching))
+	{
+		unsigned long start = __now_nsec();
+		unsigned long now;
+
+		__lock();
+		now = __now_nsec();
+		if (now - start > stat->max_wait_nsec)
+			stat->max_wait_nsec = now - start;
+
+		/* Time from the release by another thread to this acquisition */
+		if (last_holder && last_holder != &stat->nr_ops)
+		{
+			handoff_nsec += now - last_released_nsec;
+			nr_handoffs++;
+		}
+		stat->nr_ops++;
+		last_holder = &stat->nr_ops;
+		last_released_nsec = __now_nsec();
+		__unlock();
+	}
+	return 0;
+}
+
+struct bench_result
+{
+	unsigned long ops_per_sec;
+	unsigned long handoff_nsec;
+	unsigned long max_wait_usec;
+};
+
+static void __bench_lock(int nr_threads, struct bench_result *result)
+{
+	pthread_t threads[nr_threads];
+	struct bench_stat stats[nr_threads];
+	unsigned long total = 0, max_wait = 0;
+
+	__init_lock();
+	keep_benching = true;
+	last_holder = NULL;
+	handoff_nsec = nr_handoffs = 0;
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+
+	for (int i = 0; i < nr_threads; i++)
+	{
+		stats[i].nr_ops = 0;
+		stats[i].max_wait_nsec = 0;
+		pthread_create(threads + i, NULL, bench_thread, stats + i);
+	}
+	pthread_barrier_wait(&barrier);
+	usleep(bench_duration_msec * 1000);
+	ACCESS_ONCE(keep_benching) = false;
+
+	for (int i = 0; i < nr_threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+		total += stats[i].nr_ops;
+		if (stats[i].max_wait_nsec > max_wait)
+			max_wait = stats[i].max_wait_nsec;
+	}
+	pthread_barrier_destroy(&barrier);
+	__fini_lock();
+
+	result->ops_per_sec = total * 1000 / bench_duration_msec;
+	result->handoff_nsec = nr_handoffs ? handoff_nsec / nr_handoffs : 0;
+	result->max_wait_usec = max_wait / 1000;
+}
+
+/*********************************************************************
+ * Reader-writer lock benchmark.
+ * @nr_testers threads read or write the shared state at the given ratio.
+ * Compare the aggregate throughput to the case that every access is
+ * serialized with the CAS spinlock.
+ */
+static int nr_readers_in = 0;
+static int nr_writers_in = 0;
+static int write_permille;
+
+static void *bench_rw_thread(void *_arg_)
+{
+	unsigned long *nr_ops = _arg_;
+	unsigned int seed = (unsigned int)(unsigned long)_arg_;
+
+	pthread_barrier_wait(&barrier);
+	while (ACCESS_ONCE(keep_benching))
+	{
+		bool write = rand_r(&seed) % 1000 < write_permille;
+
+		if (lock_type == lock_spinlock)
+		{
+			acquire_spinlock(testlock);
+			(*nr_ops)++;
+			release_spinlock(testlock);
+			continue;
+		}
+
+		if (write)
+		{
+			acquire_write(testlock);
+			assert(nr_readers_in == 0 && nr_writers_in == 0);
+			nr_writers_in++;
+			(*nr_ops)++;
+			nr_writers_in--;
+			release_write(testlock);
+		}
+		else
+		{
+			acquire_read(testlock);
+			fetch_and_add(&nr_readers_in, 1);
+			assert(nr_writers_in == 0);
+			(*nr_ops)++;
+			fetch_and_add(&nr_readers_in, -1);
+			release_read(testlock);
+		}
+	}
+	return 0;
+}
+
+static unsigned long __bench_rwlock(void)
+{
+	pthread_t threads[nr_testers];
+	unsigned long nr_ops[nr_testers];
+	unsigned long total = 0;
+
+	__init_lock();
+	keep_benching = true;
+	pthread_barrier_init(&barrier, NULL, nr_testers + 1);
+
+	for (int i = 0; i < nr_testers; i++)
+	{
+		nr_ops[i] = 0;
+		pthread_create(threads + i, NULL, bench_rw_thread, nr_ops + i);
+	}
+	pthread_barrier_wait(&barrier);
+	usleep(bench_duration_msec * 1000);
+	ACCESS_ONCE(keep_benching) = false;
+
+	for (int i = 0; i < nr_testers; i++)
+	{
+		pthread_join(threads[i], NULL);
+		total += nr_ops[i];
+	}
+	pthread_barrier_destroy(&barrier);
+	__fini_lock();
+
+	return total * 1000 / bench_duration_msec;
+}
+
+static void bench_rwlock(void)
+{
+	const int ratios[] = {0, 10, 100, 500, 1000};
+
+	fprintf(stderr, "   %d threads  %14s %14s   (operations/sec)\n",
+					nr_testers, lock_names[lock_rwspinlock], lock_names[lock_spinlock]);
+
+	for (int i = 0; i < sizeof(ratios) / sizeof(ratios[0]); i++)
+	{
+		unsigned long ops, baseline_ops;
+
+		write_permille = ratios[i];
+
+		lock_type = lock_rwspinlock;
+		ops = __bench_rwlock();
+
+		lock_type = lock_spinlock;
+		baseline_ops = __bench_rwlock();
+
+		fprintf(stderr, "   %5.1f%% writes %14lu %14lu\n",
+						write_permille / 10.0, ops, baseline_ops);
+	}
+}
+
+/* Double the number of threads, but do not skip over @nr_testers */
+static int __next_nr_threads(int n)
+{
+	if (n < nr_testers && n * 2 > nr_testers)
+		return nr_testers;
+	return n * 2;
+}
+
+void bench_lock(enum lock_types _lock_type_)
+{
+	enum lock_types types[2];
+	enum mutex_policies policies[2] = {mutex_policy, mutex_policy};
+	enum mutex_policies saved_policy = mutex_policy;
+	char names[2][32];
+
+	lock_type = _lock_type_;
+	testlock = malloc(4096);
+
+	if (lock_type == lock_rwspinlock)
+	{
+		bench_rwlock();
+		free(testlock);
+		return;
+	}
+
+	types[0] = _lock_type_;
+	types[1] = __lock_is_spinning() ? lock_spinlock : lock_mutex;
+	snprintf(names[0], sizeof(names[0]), "%s", lock_names[types[0]]);
+	snprintf(names[1], sizeof(names[1]), "%s", lock_names[types[1]]);
+
+#ifdef CONFIG_FUTEX_MUTEX
+	/* The futex mutex has no policies to compare, so stand it against the spinlock */
+	if (_lock_type_ == lock_mutex)
+	{
+		types[1] = lock_spinlock;
+		snprintf(names[1], sizeof(names[1]), "%s", lock_names[types[1]]);
+	}
+#else
+	/* Put the mutex policies side by side instead of the same mutex twice */
+	if (_lock_type_ == lock_mutex)
+	{
+		policies[0] = mutex_fifo;
+		policies[1] = mutex_barging;
+		snprintf(names[0], sizeof(names[0]), "mutex/fifo");
+		snprintf(names[1], sizeof(names[1]), "mutex/barging");
+	}
+#endif
+
+	fprintf(stderr, "   threads %14s %10s %10s %14s %10s %10s\n",
+					names[0], "handoff", "max wait", names[1], "handoff", "max wait");
+	fprintf(stderr, "           %14s %10s %10s %14s %10s %10s\n",
+					"ops/sec", "nsec", "usec", "ops/sec", "nsec", "usec");
+
+	for (int n = 1; n <= nr_testers; n = __next_nr_threads(n))
+	{
+		struct bench_result results[2];
+
+		for (int i = 0; i < 2; i++)
+		{
+			lock_type = types[i];
+			mutex_policy = policies[i];
+			__bench_lock(n, results + i);
+		}
+
+		fprintf(stderr, "   %7d %14lu %10lu %10lu %14lu %10lu %10lu\n", n,
+						results[0].ops_per_sec, results[0].handoff_nsec, results[0].max_wait_usec,
+						results[1].ops_per_sec, results[1].handoff_nsec, results[1].max_wait_usec);
+	}
+	if (_lock_type_ == lock_ttas)
+	{
+		fprintf(stderr, "   Backoff: %d - %d pause iterations\n",
+						ttas_min_backoff, ttas_max_backoff);
+	}
+#ifndef CONFIG_FUTEX_MUTEX
+	if (_lock_type_ == lock_mutex)
+	{
+		fprintf(stderr, "   Starvation window: %u usec\n", mutex_starvation_usec);
+	}
+#endif
+
+	mutex_policy = saved_policy;
+	free(testlock);
+}
+
+/*********************************************************************
+ * Ping-pong benchmark for the thread parking backends.
+ * Two threads keep waking up each other, so every round trip consists of
+ * two park()/unpark() pairs.
+ */
+static const int nr_pingpongs = 20000;
+static struct parker *pingpong_parkers[2];
+
+static void *pingpong_thread(void *_arg_)
+{
+	long id = (long)_arg_;
+
+	pingpong_parkers[id] = self_parker();
+	pthread_barrier_wait(&barrier);
+
+	for (int i = 0; i < nr_pingpongs; i++)
+	{
+		if (id == 0)
+		{
+			unpark(pingpong_parkers[1]);
+			park(pingpong_parkers[0]);
+		}
+		else
+		{
+			park(pingpong_parkers[1]);
+			unpark(pingpong_parkers[0]);
+		}
+	}
+	return 0;
+}
+
+void bench_park(void)
+{
+	enum park_types saved = get_park_type();
+
+	fprintf(stderr, "   %10s %14s\n", "backend", "wake-up nsec");
+
+	for (int type = 0; type < nr_park_types; type++)
+	{
+		pthread_t threads[2];
+		unsigned long start;
+
+		set_park_type(type);
+		pthread_barrier_init(&barrier, NULL, 3);
+		for (long i = 0; i < 2; i++)
+		{
+			pthread_create(threads + i, NULL, pingpong_thread, (void *)i);
+		}
+		pthread_barrier_wait(&barrier);
+
+		start = __now_nsec();
+		for (int i = 0; i < 2; i++)
+		{
+			pthread_join(threads[i], NULL);
+		}
+		fprintf(stderr, "   %10s %14lu\n", park_type_names[type],
+						(__now_nsec() - start) / (nr_pingpongs * 2));
+		pthread_barrier_destroy(&barrier);
+	}
+
+	set_park_type(saved);
+}
@@ -22,6 +22,8 @@ typedef int bool;
 
 extern bool verbose;
 
+#define CACHELINE_SIZE 64
+
 
 
 /* Belows are for the framework, so don't use them */
@@ -30,13 +32,30 @@ enum lock_types {
 	lock_spinlock = 0,
 	lock_mutex = 1,
 	lock_semaphore = 2,
+	lock_ticket = 3,
+	lock_mcs = 4,
+	lock_clh = 5,
+	lock_ttas = 6,
+	lock_rwspinlock = 7,
+	lock_adaptive = 8,
 };
 
 #define MIN_VALUE 0
 #define MAX_VALUE 128
 
+extern int nr_testers;
+extern int ttas_min_backoff;
+extern int ttas_max_backoff;
+extern int adaptive_spin_budget;
+extern unsigned int mutex_starvation_usec;
+
 extern int nr_generators;
 extern unsigned long nr_generate;
+extern int ring_batch;
+extern int nr_sources;
+
+#define MAX_CONSUMERS 16
+extern int nr_consumers;
 
 extern int counter_delay_usec;
 extern int generator_delay_usec;